@@ -0,0 +1,29 @@
+// Toy example compute variance with TMB, from sufficient statistics
+// Same likelihood as TMBvariance.cpp, with the data reduced to n, sum(x)
+// and sum(x^2):
+//   sum((x - m)^2) = sum_x2 - 2*m*sum_x + n*m^2
+
+#include <TMB.hpp>
+
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  // n, sum(x), sum(x^2): the data
+  DATA_SCALAR(n);
+  DATA_SCALAR(sum_x);
+  DATA_SCALAR(sum_x2);
+  
+  // mean
+  PARAMETER(m);
+
+  // variance
+  PARAMETER(sigma2);
+  
+  Type nLL=0;
+  
+  Type ss = sum_x2 - Type(2)*m*sum_x + n*m*m;
+  nLL += Type(0.5)*n*log(Type(2*M_PI)*sigma2) + Type(0.5)*ss/sigma2;
+    
+  return nLL;
+}
@@ -9,7 +9,10 @@ template<class Type>
 Type objective_function<Type>::operator() ()
 {
   // y: the response
+  // DATA_UPDATE: a bootstrap can swap in a simulated response through
+  // obj$env$data$y without retaping (see TMBglmm_bootstrap.R)
   DATA_VECTOR(y);
+  DATA_UPDATE(y);
 
   // X: design matrix of linear predictors
   DATA_MATRIX(X);
@@ -23,6 +26,9 @@ Type objective_function<Type>::operator() ()
   // indicators for variance components
   DATA_IVECTOR(Lind);
 
+  // number of responses drawn by obj$simulate()
+  DATA_INTEGER(nsim);
+
   // variance components parameters
   PARAMETER_VECTOR(theta);
 
@@ -60,5 +66,15 @@ Type objective_function<Type>::operator() ()
   // parametrized with mean and variance
   nLL -= dnbinom2(y, mu, variances, true).sum();
 
+  // nsim new responses given u, one per column
+  SIMULATE {
+    matrix<Type> ysim(y.size(), nsim);
+    for (int j = 0; j < nsim; ++j) {
+      vector<Type> yj = rnbinom2(mu, variances);
+      ysim.col(j) = yj.matrix();
+    }
+    REPORT(ysim);
+  }
+
   return nLL;
 }
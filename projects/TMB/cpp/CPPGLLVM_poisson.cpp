@@ -1,6 +1,17 @@
 //GLLVMs for Poisson distribution
+//
+// Parallel evaluation: every PARALLEL_REGION below is one unit of work, one
+// site for the latent variable terms and one tile of species (columns of y)
+// for the Poisson terms. When compiled with OpenMP, TMB hands the units out
+// round-robin to openmp(n) threads, each thread tapes only its own units, and
+// the per-thread results are added in thread order, so fn/gr/Hessian are
+// deterministic for a given thread count. Without OpenMP every region runs
+// and the objective equals the parallel one up to rounding.
 #include<math.h>
 #include <TMB.hpp>
+
+#include "gllvm_poisson.hpp"
+
 template<class Type>
 Type objective_function<Type>::operator() ()
 {
@@ -13,54 +24,42 @@ Type objective_function<Type>::operator() ()
   PARAMETER_VECTOR(lambda);
   PARAMETER_VECTOR(loglam);
   PARAMETER_MATRIX(u); //latent variables, u, are treated as parameters
-  
-  vector<Type> lam_diag = exp(loglam); 
+
+  vector<Type> lam_diag = exp(loglam);
   int n = y.rows();
   int p = y.cols();
-  //To create lambda as matrix upper triangle
-  matrix<Type> newlam(num_lv,p);
-  for (int j = 0; j < p; j++){
-    for (int i = 0; i < num_lv; i++){
-      if (j < i)
-        newlam(i, j) = 0;
-      else if(i == j)
-        newlam(i, j) = lam_diag(j);
-      else
-        newlam(i, j) = lambda(i*p - (i + 1)*i/2 + (j - 1) - i   );
-    }
-  }
-  
-  matrix<Type> lam = u*newlam;
-  
-  //eta function b0 + x*b + u*lambda
-  matrix<Type> eta(n,p);
-  eta = x*b + lam;
-  for(int i = 0; i < n; i++){
-    for(int j = 0; j < p; j++){
-      eta(i, j) = b0(j) + eta(i, j);
-    }
-  }
-  
+
   Type nll = 0.0; // initial value of log-likelihood
-  //latent variable is assumed to be from N(0,1)
-  for (int j = 0; j < u.cols(); j++){
-    for (int i = 0; i < n; i++) {
-      nll -= dnorm(u(i,j), Type(0), Type(1), true);
+  //latent variable is assumed to be from N(0,1), one region per site
+  for (int i = 0; i < n; i++) {
+    PARALLEL_REGION {
+      for (int j = 0; j < u.cols(); j++){
+        nll -= dnorm(u(i,j), Type(0), Type(1), true);
+      }
     }
   }
-  //likelihood poisson model with the log link function
-  for (int j = 0; j < p ; j++){
-    for (int i = 0 ; i < n; i++) {
-      nll -= dpois(y(i,j), exp(eta(i,j)), true);
+  //likelihood poisson model with the log link function, one region per tile
+  //of species, dispatched to the kernel for the number of latent variables
+  for (int j0 = 0; j0 < p; j0 += tile_p){
+    PARALLEL_REGION {
+      int j1 = std::min(j0 + tile_p, p);
+      nll -= gllvm_dispatch<gllvm_tile_kernel, Type>(num_lv, y, x, b0, b, lambda, lam_diag, u, j0, j1);
     }
   }
-  
-  REPORT(newlam);
+
+  //the dense loadings and full n x p products are only needed for
+  //reporting, so keep them off the tape
+  if (isDouble<Type>::value) {
+    //To create lambda as matrix upper triangle
+    matrix<Type> newlam = gllvm_newlam(lambda, lam_diag, num_lv, p);
+    matrix<Type> lam = u*newlam;
+    REPORT(newlam);
+    REPORT(lam);
+  }
   REPORT(lambda);
-  REPORT(lam);
   REPORT(b0);
   REPORT(b);
   REPORT(u);
-  
+
   return nll;
-}
\ No newline at end of file
+}
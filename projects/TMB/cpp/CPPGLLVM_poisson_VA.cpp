@@ -0,0 +1,71 @@
+//GLLVMs for Poisson distribution, variational approximation
+//
+// Same model as CPPGLLVM_poisson.cpp, but instead of integrating the latent
+// variables out with the Laplace approximation (random = "u"), each site
+// gets a Gaussian variational posterior u_i ~ N(u_i, A_i). The objective is
+// the negative evidence lower bound, which has a closed form for the Poisson
+// log link, so everything (model and variational parameters) is fitted in
+// one smooth optimisation with no random effects and no inner Newton.
+//
+// A_i = L_i L_i' with L_i lower triangular: diag(L_i) = exp(A_logdiag(i, )),
+// below the diagonal A_lower(i, ) (num_lv*(num_lv - 1)/2 columns, zero
+// columns when num_lv = 1). Parallel regions as in CPPGLLVM_poisson.cpp.
+#include<math.h>
+#include <TMB.hpp>
+
+#include "gllvm_poisson.hpp"
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  //declares all data and parameters used
+  DATA_MATRIX(y);
+  DATA_MATRIX(x);
+  DATA_INTEGER(num_lv);
+  PARAMETER_VECTOR(b0);
+  PARAMETER_MATRIX(b);
+  PARAMETER_VECTOR(lambda);
+  PARAMETER_VECTOR(loglam);
+  PARAMETER_MATRIX(u);          //variational means of the latent variables
+  PARAMETER_MATRIX(A_logdiag);  //log diagonal of the variational Cholesky factors
+  PARAMETER_MATRIX(A_lower);    //strictly lower part of the variational Cholesky factors
+
+  vector<Type> lam_diag = exp(loglam);
+  int n = y.rows();
+  int p = y.cols();
+
+  Type nll = 0.0; // negative ELBO
+  //KL divergence of N(u_i, A_i) from the N(0, I) prior, one region per site:
+  //(tr(A_i) + u_i'u_i - log|A_i| - num_lv)/2
+  for (int i = 0; i < n; i++) {
+    PARALLEL_REGION {
+      Type kl = -Type(num_lv);
+      for (int k = 0; k < num_lv; k++){
+        kl += exp(Type(2)*A_logdiag(i,k)) + u(i,k)*u(i,k) - Type(2)*A_logdiag(i,k);
+      }
+      for (int l = 0; l < A_lower.cols(); l++){
+        kl += A_lower(i,l)*A_lower(i,l);
+      }
+      nll += Type(0.5)*kl;
+    }
+  }
+  //expected poisson log-likelihood, one region per tile of species
+  for (int j0 = 0; j0 < p; j0 += tile_p){
+    PARALLEL_REGION {
+      int j1 = std::min(j0 + tile_p, p);
+      nll -= gllvm_dispatch<gllvm_va_tile_kernel, Type>(num_lv, y, x, b0, b, lambda, lam_diag, u, A_logdiag, A_lower, j0, j1);
+    }
+  }
+
+  if (isDouble<Type>::value) {
+    //To create lambda as matrix upper triangle
+    matrix<Type> newlam = gllvm_newlam(lambda, lam_diag, num_lv, p);
+    REPORT(newlam);
+  }
+  REPORT(lambda);
+  REPORT(b0);
+  REPORT(b);
+  REPORT(u);
+
+  return nll;
+}
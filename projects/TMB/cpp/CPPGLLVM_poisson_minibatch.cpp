@@ -0,0 +1,66 @@
+//GLLVMs for Poisson distribution, mini-batch variational approximation
+//
+// The variational objective of CPPGLLVM_poisson_VA.cpp is a sum over sites,
+// so it can be estimated without bias from a random batch of m site rows,
+// scaled by scale = n/m. This template is taped once for a batch of fixed
+// size m: y and x hold the batch rows and are marked DATA_UPDATE, so a
+// driver can swap in a new batch through obj$env$data without retaping,
+// and u, A_logdiag and A_lower are the variational parameters of the
+// sampled sites only (the driver keeps the full n-row copies and copies
+// the batch rows in and out). See R/TMBGLLVM_poisson_minibatch.R.
+#include<math.h>
+#include <TMB.hpp>
+
+#include "gllvm_poisson.hpp"
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  //declares all data and parameters used
+  DATA_MATRIX(y);         //counts of the m sampled sites
+  DATA_UPDATE(y);
+  DATA_MATRIX(x);         //covariates of the m sampled sites
+  DATA_UPDATE(x);
+  DATA_INTEGER(num_lv);
+  DATA_SCALAR(scale);     //n/m, total over sampled sites
+  PARAMETER_VECTOR(b0);
+  PARAMETER_MATRIX(b);
+  PARAMETER_VECTOR(lambda);
+  PARAMETER_VECTOR(loglam);
+  PARAMETER_MATRIX(u);          //variational means of the sampled sites
+  PARAMETER_MATRIX(A_logdiag);  //log diagonal of their variational Cholesky factors
+  PARAMETER_MATRIX(A_lower);    //strictly lower part of their variational Cholesky factors
+
+  vector<Type> lam_diag = exp(loglam);
+  int m = y.rows();
+  int p = y.cols();
+
+  Type nll = 0.0; // negative ELBO of the batch
+  //KL divergence of N(u_i, A_i) from the N(0, I) prior, one region per site
+  for (int i = 0; i < m; i++) {
+    PARALLEL_REGION {
+      Type kl = -Type(num_lv);
+      for (int k = 0; k < num_lv; k++){
+        kl += exp(Type(2)*A_logdiag(i,k)) + u(i,k)*u(i,k) - Type(2)*A_logdiag(i,k);
+      }
+      for (int l = 0; l < A_lower.cols(); l++){
+        kl += A_lower(i,l)*A_lower(i,l);
+      }
+      nll += Type(0.5)*kl;
+    }
+  }
+  //expected poisson log-likelihood, one region per tile of species
+  for (int j0 = 0; j0 < p; j0 += tile_p){
+    PARALLEL_REGION {
+      int j1 = std::min(j0 + tile_p, p);
+      nll -= gllvm_dispatch<gllvm_va_tile_kernel, Type>(num_lv, y, x, b0, b, lambda, lam_diag, u, A_logdiag, A_lower, j0, j1);
+    }
+  }
+
+  REPORT(b0);
+  REPORT(b);
+  REPORT(lambda);
+
+  //unbiased estimate of the full-data negative ELBO
+  return scale*nll;
+}
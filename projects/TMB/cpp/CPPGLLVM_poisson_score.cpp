@@ -0,0 +1,80 @@
+//GLLVMs for Poisson distribution, scoring of new sites
+//
+// Ordination scores for newly surveyed sites against a fitted
+// CPPGLLVM_poisson.cpp model. b0, b, lambda and loglam are passed at their
+// fitted values and each new site's latent variables are found on their
+// own by step-halving Newton iterations (gllvm_score_site), so nothing is
+// refitted. REPORT gives the scores u_hat, their approximate standard
+// errors u_se and the gradient norm at each score, grad_norm, with
+// converged = (grad_norm < newton_tol). The objective is the Laplace
+// approximation of -log p(y_new), which also scores how well each new site
+// fits the ordination (REPORT(site_nll)).
+// Each site is its own PARALLEL_REGION; for scores alone build the object
+// with type = "Fun" and split sites across workers (see
+// R/TMBGLLVM_poisson_score.R).
+#include<math.h>
+#include <TMB.hpp>
+
+#include "gllvm_poisson.hpp"
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  //declares all data and parameters used
+  DATA_MATRIX(y);            //counts of the new sites
+  DATA_MATRIX(x);            //covariates of the new sites
+  DATA_INTEGER(num_lv);
+  DATA_INTEGER(newton_iter); //maximum Newton iterations per site
+  DATA_SCALAR(newton_tol);   //stop once the gradient norm is below this
+  PARAMETER_VECTOR(b0);      //fitted values
+  PARAMETER_MATRIX(b);
+  PARAMETER_VECTOR(lambda);
+  PARAMETER_VECTOR(loglam);
+
+  vector<Type> lam_diag = exp(loglam);
+  int n = y.rows();
+  int p = y.cols();
+
+  //To create lambda as matrix upper triangle
+  matrix<Type> newlam = gllvm_newlam(lambda, lam_diag, num_lv, p);
+
+  matrix<Type> u_hat(n, num_lv);
+  matrix<Type> u_se(n, num_lv);
+  vector<Type> site_nll(n);
+  vector<Type> grad_norm(n);
+  u_hat.setZero();
+  u_se.setZero();
+  site_nll.setZero();
+  grad_norm.setZero();
+
+  Type nll = 0.0;
+  vector<Type> y_i(p), offset(p), u_i(num_lv), se_i(num_lv);
+  for (int i = 0; i < n; i++) {
+    PARALLEL_REGION {
+      for (int j = 0; j < p; j++){
+        y_i(j) = y(i, j);
+        offset(j) = b0(j);
+        for (int k = 0; k < x.cols(); k++)
+          offset(j) += x(i, k)*b(k, j);
+      }
+      site_nll(i) = gllvm_dispatch<gllvm_score_site_kernel, Type>(num_lv, y_i, offset, newlam, newton_iter, asDouble(newton_tol),
+                                                                    u_i, se_i, grad_norm(i));
+      for (int k = 0; k < num_lv; k++){
+        u_hat(i, k) = u_i(k);
+        u_se(i, k) = se_i(k);
+      }
+      nll += site_nll(i);
+    }
+  }
+
+  REPORT(u_hat);
+  REPORT(u_se);
+  REPORT(site_nll);
+  REPORT(grad_norm);
+  vector<Type> converged(n);
+  for (int i = 0; i < n; i++)
+    converged(i) = (asDouble(grad_norm(i)) < asDouble(newton_tol)) ? Type(1) : Type(0);
+  REPORT(converged);
+
+  return nll;
+}
@@ -0,0 +1,60 @@
+//GLLVMs for Poisson distribution, sparse counts
+//
+// Same model as CPPGLLVM_poisson.cpp for count matrices that are mostly
+// zeros. y is passed as a sparse matrix (e.g. as(y, "TsparseMatrix") from
+// the Matrix package), so only its non-zeros are stored, and the Poisson
+// log-density is evaluated as one sum of exp(eta) over all cells plus
+// y*eta and lgamma(y + 1) terms over the non-zeros only (see
+// gllvm_sparse_tile_nll). Parallel regions as in CPPGLLVM_poisson.cpp.
+#include<math.h>
+#include <TMB.hpp>
+
+#include "gllvm_poisson.hpp"
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  //declares all data and parameters used
+  DATA_SPARSE_MATRIX(y);
+  DATA_MATRIX(x);
+  DATA_INTEGER(num_lv);
+  PARAMETER_VECTOR(b0);
+  PARAMETER_MATRIX(b);
+  PARAMETER_VECTOR(lambda);
+  PARAMETER_VECTOR(loglam);
+  PARAMETER_MATRIX(u); //latent variables, u, are treated as parameters
+
+  vector<Type> lam_diag = exp(loglam);
+  int n = y.rows();
+  int p = y.cols();
+
+  Type nll = 0.0; // initial value of log-likelihood
+  //latent variable is assumed to be from N(0,1), one region per site
+  for (int i = 0; i < n; i++) {
+    PARALLEL_REGION {
+      for (int j = 0; j < u.cols(); j++){
+        nll -= dnorm(u(i,j), Type(0), Type(1), true);
+      }
+    }
+  }
+  //likelihood poisson model with the log link function, one region per tile
+  //of species, dispatched to the kernel for the number of latent variables
+  for (int j0 = 0; j0 < p; j0 += tile_p){
+    PARALLEL_REGION {
+      int j1 = std::min(j0 + tile_p, p);
+      nll -= gllvm_dispatch<gllvm_sparse_tile_kernel, Type>(num_lv, y, x, b0, b, lambda, lam_diag, u, j0, j1);
+    }
+  }
+
+  if (isDouble<Type>::value) {
+    //To create lambda as matrix upper triangle
+    matrix<Type> newlam = gllvm_newlam(lambda, lam_diag, num_lv, p);
+    REPORT(newlam);
+  }
+  REPORT(lambda);
+  REPORT(b0);
+  REPORT(b);
+  REPORT(u);
+
+  return nll;
+}
@@ -8,7 +8,8 @@ template<class Type>
   DATA_VECTOR(Y);         // Response vector
   DATA_MATRIX(X);         // Design matrix
   DATA_MATRIX(Z);         // Random effect matrix
-  DATA_IVECTOR(group);        // The factor for which we require random intercepts
+  DATA_IVECTOR(group_ptr);    // Rows sorted by group: level k owns rows group_ptr(k) to group_ptr(k+1)-1
+                              // (in R: sort rows by group, group_ptr = c(0, cumsum(tabulate(group, nlevels))))
   DATA_INTEGER(k_size);        // number of random effects
   DATA_INTEGER(nlevels);        // number of levels in random effects
   
@@ -44,15 +45,17 @@ template<class Type>
   
   vector<Type> mu(N);
   vector<Type> nu(N);
-  vector<Type> Zi(k_size);
   vector<Type> uj(k_size);
-  int k;                   // will act as a loop control variable between R and cpp
 
-  for(int i = 0; i < N; i++){
-    k = group(i) - 1;       // set the LCV to reflect the group level of the observations
-    uj = u.col(k);
-    Zi = Z.row(i);
-    nu(i) = XB(i) + (Zi * uj).sum();
+  // Z*u one group at a time: the rows of level k are contiguous and read
+  // that level's coefficients u(, k) in place
+  nu = XB;
+  for(int k = 0; k < nlevels; k++){
+    for(int i = group_ptr(k); i < group_ptr(k + 1); i++){
+      for(int r = 0; r < k_size; r++){
+        nu(i) += Z(i, r) * u(r, k);
+      }
+    }
   }
   
   // nu = XB + Zu;
@@ -1,5 +1,6 @@
 // Simple Random Intercept Model
 #include <TMB.hpp>
+#include "mvnorm_batch.hpp"
 
 template<class Type>
   Type objective_function<Type>::operator() ()
@@ -7,31 +8,26 @@ template<class Type>
   // Data to be input
   DATA_VECTOR(Y);         // Response vector
   DATA_MATRIX(X);         // Design matrix
-  DATA_MATRIX(Z);         // Random effect matrix
-  DATA_IVECTOR(group);        // The factor for which we require random intercepts
+  DATA_SPARSE_MATRIX(Z);  // Random effect matrix, N x (k_size*nlevels), columns in the order of u
+                          // (level by level, as lme4's getME(m, "Z") for a single term)
+                          // Crossed or nested factors with the same k_size: append their levels as further columns
   DATA_INTEGER(k_size);        // number of random effects
-  DATA_INTEGER(nlevels);        // number of levels in random effects
   
   // Parameters
   PARAMETER_VECTOR(Beta);         // Vector of beta values
   PARAMETER_ARRAY(u);             // Intercept for given random effect (/factor)
-  PARAMETER_VECTOR(logsig1);      // Random effect sd
-  PARAMETER(transformed_rho);     // parameter of correlation
-  
-  // Load namespace which contains the multivariate distributions
-  using namespace density;
-  /// define a matrix for the var-covar matrix for the multivariate normal
-  matrix<Type> covrand(k_size, k_size); 
-  vector<Type> sd = exp(logsig1);   /// Take the exponential of the log std dev.
-  Type rho = 2.0 / (1.0 + exp(-transformed_rho)) - 1.0;   /// To keep the correlation coef between -1, 1, use a shifted logistic form
+  PARAMETER_VECTOR(log_chol_diag); // log diagonal of the Cholesky factor of the random effect covariance
+  PARAMETER_VECTOR(chol_lower);   // strictly lower Cholesky entries, column-major, k_size*(k_size-1)/2
   
+  /// Unstructured covariance parameterised by its Cholesky factor, L L' is
+  /// positive definite for any parameter values and the density uses L directly
+  matrix<Type> L = chol_from_par(log_chol_diag, chol_lower);
+  matrix<Type> covrand = L * L.transpose();
+  vector<Type> sd = covrand.diagonal().array().sqrt();
+  matrix<Type> corr(k_size, k_size);
   for(int i = 0; i < k_size; i++){
     for(int j = 0; j < k_size; j++){
-      if(i == j){
-        covrand(i, j) = pow(sd(i),2);
-      } else {
-        covrand(i, j) = rho*sd(i)*sd(j);
-      }
+      corr(i, j) = covrand(i, j) / (sd(i) * sd(j));
     }
   }
   
@@ -39,19 +35,11 @@ template<class Type>
   
   vector<Type> mu(N);
   vector<Type> eta(N);
-  vector<Type> Zi(k_size);
-  vector<Type> uj(k_size);
-  int k;                   // will act as a loop control variable between R and cpp
   
   vector<Type> XB = X * Beta; // pre-calculate the design matrix times beta vector
 
-  for(int i = 0; i < N; i++){
-    k = group(i) - 1;       // set the LCV to reflect the group level of the observations
-    uj = u.col(k);
-    Zi = Z.row(i);
-    // eta
-    eta(i) = XB(i) + (Zi * uj).sum();
-  }
+  // Z*u as a sparse product: only the non-zeros of Z are stored and visited
+  eta = XB + Z * u.vec();
   
   mu = exp(eta);
   
@@ -62,11 +50,7 @@ template<class Type>
   }
   
   // Component 2 - Random effects distribution
-  MVNORM_t<Type> neg_log_density(covrand);
-  for(int j = 0; j < nlevels; j++){
-    uj = u.col(j);
-    nll += neg_log_density(uj); // Process likelihood
-  }
+  nll += mvnorm_chol_batch_nll(L, u.matrix()); // Process likelihood, all levels in one pass
   
   ADREPORT(nll);
   REPORT(nll);
@@ -76,8 +60,8 @@ template<class Type>
   REPORT(covrand);
   ADREPORT(sd);
   REPORT(sd);
-  ADREPORT(rho);
-  REPORT(rho);
+  ADREPORT(corr);
+  REPORT(corr);
   
   return nll;
 }
\ No newline at end of file
@@ -0,0 +1,34 @@
+// Binomial GLM on aggregated data
+// Same model as CPPbinom.cpp, but each row is one distinct covariate
+// pattern with y successes out of size trials, so the cost is proportional
+// to the number of patterns rather than the number of Bernoulli rows
+// (see aggregate_binomial() in R/TMBbinom_aggregated.R)
+
+#include <TMB.hpp>
+
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  // y: number of successes of each pattern
+  DATA_VECTOR(y);
+
+  // size: number of trials of each pattern
+  DATA_VECTOR(size);
+
+  // X: design matrix of the distinct covariate patterns
+  DATA_MATRIX(X);
+
+  // fixed effects parameters
+  PARAMETER_VECTOR(beta);
+
+  Type nLL = 0.0;
+  
+  vector<Type> XB = X * beta; // pre-calculate the design matrix times beta vector
+
+  for(int i=0; i<y.size(); i++){
+    nLL -= dbinom_robust(y(i), size(i), XB(i), true);
+  }
+    
+  return nLL;
+}
@@ -1,5 +1,6 @@
 // Simple Random Intercept Model
 #include <TMB.hpp>
+#include "mvnorm_batch.hpp"
 
 template<class Type>
 Type objective_function<Type>::operator() ()
@@ -13,23 +14,18 @@ Type objective_function<Type>::operator() ()
   // Parameters
   PARAMETER_VECTOR(Beta);         // Vector of beta values
   PARAMETER_VECTOR(u);             // Intercept for given random effect (/factor)
-  PARAMETER_VECTOR(logsig1);      // Random effect sd
-  PARAMETER(transformed_rho);     // parameter of correlation
+  PARAMETER_VECTOR(log_chol_diag); // log diagonal of the Cholesky factor of the random effect covariance
+  PARAMETER_VECTOR(chol_lower);   // strictly lower Cholesky entries, column-major, k_size*(k_size-1)/2
   
-  // Load namespace which contains the multivariate distributions
-  using namespace density;
-  /// define a matrix for the var-covar matrix for the multivariate normal
-  matrix<Type> cov(k_size, k_size); 
-  vector<Type> sd = exp(logsig1);   /// Take the exponential of the log std dev.
-  Type rho = 2.0 / (1.0 + exp(-transformed_rho)) - 1.0;   /// To keep the correlation coef between -1, 1, use a shifted logistic form
-
+  /// Unstructured covariance parameterised by its Cholesky factor, L L' is
+  /// positive definite for any parameter values and the density uses L directly
+  matrix<Type> L = chol_from_par(log_chol_diag, chol_lower);
+  matrix<Type> cov = L * L.transpose();
+  vector<Type> sd = cov.diagonal().array().sqrt();
+  matrix<Type> corr(k_size, k_size);
   for(int i = 0; i < k_size; i++){
     for(int j = 0; j < k_size; j++){
-      if(i == j){
-        cov(i, j) = pow(sd[i], 2);
-      } else {
-        cov(i, j) = rho*sd[i]*sd[j];
-      }
+      corr(i, j) = cov(i, j) / (sd(i) * sd(j));
     }
   }
   
@@ -48,14 +44,9 @@ Type objective_function<Type>::operator() ()
   }
 
   // Component 2 - Random effects distribution
-  MVNORM_t<Type> neg_log_density(cov);
-  vector<Type> uj(1);
-
-  int ngroups = u.size();  // define the number of factor levels i.e. random intercepts
-  for(int j = 0; j < ngroups; j++){
-    uj(0) = u(j);
-    nll += neg_log_density(uj); // Process likelihood
-  }
+  // one intercept per group, as the columns of a 1 x ngroups matrix
+  matrix<Type> U = u.matrix().transpose();
+  nll += mvnorm_chol_batch_nll(L, U); // Process likelihood
 
   
   return nll;
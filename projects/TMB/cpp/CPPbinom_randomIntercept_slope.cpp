@@ -1,5 +1,6 @@
 // Simple Random Intercept Model
 #include <TMB.hpp>
+#include "mvnorm_batch.hpp"
 
 template<class Type>
 Type objective_function<Type>::operator() ()
@@ -17,16 +18,8 @@ Type objective_function<Type>::operator() ()
   PARAMETER_VECTOR(logsig1);      // Random effect sd
   PARAMETER(transformed_rho);     // parameter of correlation
   
-  // Load namespace which contains the multivariate distributions
-  using namespace density;
-  /// define a matrix for the var-covar matrix for the multivariate normal
-  matrix<Type> cov(k_size, k_size); 
   vector<Type> sd = exp(logsig1);   /// Take the exponential of the log std dev.
   Type rho = 2.0 / (1.0 + exp(-transformed_rho)) - 1.0;   /// To keep the correlation coef between -1, 1, use a shifted logistic form
-  cov(0,0) = pow(sd[0],2);
-  cov(1,1) = pow(sd[1],2);
-  cov(0,1) = rho*sd[1]*sd[0];
-  cov(1,0) = rho*sd[1]*sd[0];
   
   Type nll = 0.0;                 // initialize negative log likelihood
   
@@ -42,14 +35,9 @@ Type objective_function<Type>::operator() ()
     nll -= dbinom_robust(Y(i), Size, log(exp(XB(i)  + u(k)  )), true);
   }
   
-  // Component 2 - Random effects distribution
-  MVNORM_t<Type> neg_log_density(cov);
-  vector<Type> uj(k_size);
-  
-  for(int j = 0; j < ngroups; j++){
-    uj = u.col(j);
-    nll += neg_log_density(uj); // Process likelihood
-  }
+  // Component 2 - Random effects distribution, covariance built from sd and
+  // rho at size k_size inside the kernel
+  nll += mvnorm_sdcor_batch_nll(sd, rho, u.matrix()); // Process likelihood, all levels in one pass
   
   return nll;
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 // Simple Random Intercept Model
 #include <TMB.hpp>
+#include "mvnorm_batch.hpp"
 
 template<class Type>
 Type objective_function<Type>::operator() ()
@@ -18,27 +19,9 @@ Type objective_function<Type>::operator() ()
   PARAMETER_VECTOR(logsig1);      // Random effect sd
   PARAMETER(transformed_rho);     // parameter of correlation
   
-  // Load namespace which contains the multivariate distributions
-  using namespace density;
-  /// define a matrix for the var-covrandar matrix for the multivariate normal
-  matrix<Type> covrand(k_size, k_size); 
   vector<Type> sd = exp(logsig1);   /// Take the exponential of the log std dev.
   Type rho = 2.0 / (1.0 + exp(-transformed_rho)) - 1.0;   /// To keep the correlation coef between -1, 1, use a shifted logistic form
   
-  
-  for(int i = 0; i < k_size; i++){
-    for(int j = 0; j < k_size; j++){
-      if(i == j){
-        covrand(i, j) = pow(sd(i),2);
-      } else {
-        covrand(i, j) = rho*sd(i)*sd(j);
-      }
-    }
-  }
-  
-  
-  ADREPORT(covrand);
-  REPORT(covrand);
   ADREPORT(sd);
   REPORT(sd);
   ADREPORT(rho);
@@ -48,30 +31,19 @@ Type objective_function<Type>::operator() ()
   int N = Y.size();
   // // Component 1 -  Observations: E(X|u)= logit(X|u)= XBeta + u
   vector<Type> XB = X * Beta; // pre-calculate the design matrix times beta vector
-  vector<Type> uj(k_size);
-  vector<Type> b0(N);
-  vector<Type> b1(N);
   
   Type Size = 1;
   int k;                   // will act as a loop control variable between R and cpp
   
   for(int i = 0; i < N; i++){
     k = Factor(i) - 1;       // set the LCV to reflect the factor level of the observations
-    b0(i) = u(0, k);
-    b1(i) = u(1, k);
     // eta = XB(i) + b0 + b1*Z(i)
-    nll -= dbinom_robust(Y(i), Size, XB(i)  + b0(i) + b1(i)*Z(i), true);
+    nll -= dbinom_robust(Y(i), Size, XB(i)  + u(0, k) + u(1, k)*Z(i), true);
   }
   
-  // Component 2 - Random effects distribution
-  MVNORM_t<Type> neg_log_density(covrand);
-  // matrix<Type> ut(k_size, ngroups); 
-
-    for(int j = 0; j < ngroups; j++){
-    // ut = u.transpose();
-    uj = u.col(j);
-    nll += neg_log_density(uj); // Process likelihood
-  }
+  // Component 2 - Random effects distribution, covariance built from sd and
+  // rho at size k_size inside the kernel
+  nll += mvnorm_sdcor_batch_nll(sd, rho, u.matrix()); // Process likelihood, all levels in one pass
   return nll;
     
 }
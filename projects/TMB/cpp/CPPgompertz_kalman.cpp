@@ -0,0 +1,108 @@
+// State-space Gompertz model, Kalman filter
+// Same model as CPPgompertztmb.cpp, but linear and Gaussian in the states,
+// so the marginal likelihood of y is computed exactly by a forward pass over
+// time and u is never a random effect: the tape only holds O(n) scalar
+// operations and the outer optimisation is over the 4 parameters alone.
+// A Rauch-Tung-Striebel backward pass recovers the smoothed states u_smooth
+// and their variances u_var, in the reports.
+//
+// Online updates (see R/TMBgompertz_online.R): a new batch of observations
+// can be fitted on its own, starting from the filtered state at the end of
+// the previous data. init = c(m0, P0) is that state's mean and variance, one
+// step before y[0]; with init empty, u[0] is diffuse as in the batch model.
+// The previous data's information about the parameters enters through a
+// quadratic prior, 0.5 (theta - prior_mean)' prior_prec (theta - prior_mean)
+// on theta = (a, b, log_sigma_proc, log_sigma_obs); no prior when prior_mean
+// is empty. m_last and P_last report the filtered state after y[n - 1].
+//
+// Batch fitting (see R/TMBgompertz_batch.R): y is DATA_UPDATE, so one tape
+// serves every series of the same length.
+#include <TMB.hpp>
+
+template<class Type>
+Type objective_function<Type>::operator() () {
+  // data:
+  DATA_VECTOR(y);
+  DATA_UPDATE(y); // any series of the taped length can be swapped in
+  DATA_VECTOR(init); // c(m0, P0) of the state before y[0], or empty
+  DATA_VECTOR(prior_mean); // prior mean of the 4 parameters, or empty
+  DATA_MATRIX(prior_prec); // prior precision of the 4 parameters
+  
+  // parameters:
+  PARAMETER(a); // population growth rate parameter
+  PARAMETER(b); // density dependence parameter
+  PARAMETER(log_sigma_proc); // log(process SD)
+  PARAMETER(log_sigma_obs); // log(observation SD)
+  
+  // procedures: (transformed parameters)
+  Type sigma_proc = exp(log_sigma_proc);
+  Type sigma_obs = exp(log_sigma_obs);
+  Type var_proc = sigma_proc * sigma_proc;
+  Type var_obs = sigma_obs * sigma_obs;
+  
+  // reports on transformed parameters:
+  ADREPORT(sigma_proc)
+    ADREPORT(sigma_obs)
+    
+    int n = y.size(); // get time series length
+  
+  Type nll = 0.0; // initialize negative log likelihood
+  
+  // predicted and filtered means and variances of u[i]
+  vector<Type> m_pred(n), P_pred(n), m_filt(n), P_filt(n);
+  
+  int i_first; // first observation with a likelihood term
+  if(init.size() == 0){
+    // u[0] has a flat prior in CPPgompertztmb.cpp: integrating it out leaves
+    // u[0] | y[0] ~ N(y[0], sigma_obs^2), and no term for y[0]
+    m_filt[0] = y[0];
+    P_filt[0] = var_obs;
+    m_pred[0] = m_filt[0];
+    P_pred[0] = P_filt[0];
+    i_first = 1;
+  } else {
+    i_first = 0;
+  }
+  
+  // forward pass: predict with the process model, update with y[i]
+  for(int i = i_first; i < n; i++){
+    Type m_prev = (i == 0) ? Type(init[0]) : m_filt[i - 1];
+    Type P_prev = (i == 0) ? Type(init[1]) : P_filt[i - 1];
+    m_pred[i] = a + b * m_prev; // Gompertz
+    P_pred[i] = b * b * P_prev + var_proc;
+    Type F = P_pred[i] + var_obs; // variance of y[i] given y[0..i-1]
+    nll -= dnorm(y[i], m_pred[i], sqrt(F), true);
+    Type K = P_pred[i] / F; // Kalman gain
+    m_filt[i] = m_pred[i] + K * (y[i] - m_pred[i]);
+    P_filt[i] = (Type(1) - K) * P_pred[i];
+  }
+  
+  // information about the parameters from earlier data
+  if(prior_mean.size() > 0){
+    vector<Type> theta(4);
+    theta << a, b, log_sigma_proc, log_sigma_obs;
+    vector<Type> d = theta - prior_mean;
+    vector<Type> prec_d = prior_prec * d;
+    nll += Type(0.5) * (d * prec_d).sum();
+  }
+  
+  Type m_last = m_filt[n - 1];
+  Type P_last = P_filt[n - 1];
+  REPORT(m_last);
+  REPORT(P_last);
+  
+  // backward pass, for reporting only
+  if(isDouble<Type>::value){
+    vector<Type> u_smooth = m_filt;
+    vector<Type> u_var = P_filt;
+    for(int i = n - 2; i >= 0; i--){
+      Type J = b * P_filt[i] / P_pred[i + 1];
+      u_smooth[i] = m_filt[i] + J * (u_smooth[i + 1] - m_pred[i + 1]);
+      u_var[i] = P_filt[i] + J * J * (u_var[i + 1] - P_pred[i + 1]);
+    }
+    REPORT(u_smooth);
+    REPORT(u_var);
+  }
+  
+  return nll;
+}
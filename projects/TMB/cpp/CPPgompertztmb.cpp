@@ -5,6 +5,7 @@ template<class Type>
 Type objective_function<Type>::operator() () {
   // data:
   DATA_VECTOR(y);
+  DATA_INTEGER(chunk_size); // time steps per parallel region (>= 1)
   
   // parameters:
   PARAMETER(a); // population growth rate parameter
@@ -25,15 +26,27 @@ Type objective_function<Type>::operator() () {
   
   Type nll = 0.0; // initialize negative log likelihood
   
-  // process model:
-  for(int i = 1; i < n; i++){
-    Type m = a + b * u[i - 1]; // Gompertz
-    nll -= dnorm(u[i], m, sigma_proc, true);
-  }
+  if(chunk_size < 1) error("chunk_size must be >= 1");
   
-  // observation model:
-  for(int i = 0; i < n; i++){
-    nll -= dnorm(y[i], u[i], sigma_obs, true);
+  // one PARALLEL_REGION per chunk of time steps [i0, i1): its process terms
+  // link it to the previous chunk through u[i0 - 1] only, so the chunks are
+  // independent units of work for openmp(n) threads and their sum is the
+  // serial objective, whatever chunk_size
+  for(int i0 = 0; i0 < n; i0 += chunk_size){
+    PARALLEL_REGION {
+      int i1 = std::min(i0 + chunk_size, n);
+      
+      // process model:
+      for(int i = std::max(i0, 1); i < i1; i++){
+        Type m = a + b * u[i - 1]; // Gompertz
+        nll -= dnorm(u[i], m, sigma_proc, true);
+      }
+      
+      // observation model:
+      for(int i = i0; i < i1; i++){
+        nll -= dnorm(y[i], u[i], sigma_obs, true);
+      }
+    }
   }
   
   return nll;
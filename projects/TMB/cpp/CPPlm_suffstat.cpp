@@ -0,0 +1,31 @@
+// Simple Linear Model from sufficient statistics
+// Same likelihood as CPPlm.cpp, but the data only enter through X'X, X'Y,
+// Y'Y and N:
+//   sum((Y - X*Beta)^2) = Y'Y - 2*Beta'X'Y + Beta'X'X*Beta
+// so each evaluation costs O(p^2) whatever the number of rows. The
+// statistics are accumulated in one pass over the data, see lm_suffstat()
+// in R/TMBlm_suffstat.R.
+#include <TMB.hpp>
+
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  // The data to be input
+  DATA_MATRIX(XtX); // X'X, p x p
+  DATA_VECTOR(XtY); // X'Y, length p
+  DATA_SCALAR(YtY); // Y'Y
+  DATA_SCALAR(N);   // number of rows
+  // The model parameters
+  PARAMETER_VECTOR(Beta); // Vector of our 3 beta values
+  PARAMETER(logsig); // natural log of the residual sd
+
+  // residual sum of squares
+  vector<Type> XtXBeta = XtX*Beta;
+  Type rss = YtY - Type(2)*(Beta*XtY).sum() + (Beta*XtXBeta).sum();
+
+  // -sum(dnorm(Y, X*Beta, exp(logsig), true)) written in terms of rss
+  Type nll = N*(logsig + Type(0.5*log(2.0*M_PI))) + Type(0.5)*rss*exp(-Type(2)*logsig);
+  return nll;
+  
+}
@@ -0,0 +1,153 @@
+// Random Intercept Model, intercepts integrated out analytically
+// Same model as CPPlmer.cpp. Marginally the observations of group g are
+// N(X_g Beta, V_g) with compound-symmetric V_g = s0^2 I + s1^2 11', so with
+// r = Y - X Beta and gamma_g = s1^2/(s0^2 + n_g s1^2):
+//   V_g^-1      = (I - gamma_g 11')/s0^2
+//   log|V_g|    = n_g log(s0^2) + log(1 + n_g s1^2/s0^2)
+//   r_g'V_g^-1 r_g = (sum(r_g^2) - gamma_g sum(r_g)^2)/s0^2
+// The data enter through X'X, X'Y, Y'Y and the per-group sums of X and Y,
+// which do not depend on the parameters, so no Laplace approximation and no
+// inner optimisation are needed: the outer optimiser only sees the variance
+// parameters (and Beta unless profiled).
+//
+// reml = 1 adds the restricted likelihood correction log|X'V^-1 X|.
+// profile = 1 replaces Beta by its GLS estimate given the variances; Beta
+// must then be passed as an empty vector. The BLUPs of the intercepts,
+// u_g = gamma_g sum(r_g), are reported either way.
+#include <TMB.hpp>
+#include "mvnorm_batch.hpp"
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  // Data to be input
+  DATA_IVECTOR(X3);        // The factor for which we require random intercepts
+  DATA_VECTOR(Y);          // Response vector
+  DATA_MATRIX(X);          // Design matrix
+  DATA_INTEGER(reml);      // 1: restricted likelihood, 0: likelihood
+  DATA_INTEGER(profile);   // 1: profile Beta out by GLS
+
+  // Parameters
+  PARAMETER_VECTOR(Beta);  // Vector of our 3 beta values, empty if profiled
+  PARAMETER(logsig1);      // Random effect sd
+  PARAMETER(logsig0);      // Residual sd
+
+  int nobs = X.rows();     // define the number of observations
+  int p = X.cols();        // define the number of fixed effects
+  int ngroups = X3.maxCoeff(); // define the number of factor levels
+  int k;                   // will act as a loop control variable
+
+  // Sufficient statistics: constants, computed from the data alone
+  matrix<Type> XtX(p, p);
+  vector<Type> XtY(p);
+  Type YtY = 0.0;
+  matrix<Type> sx(ngroups, p); // per-group column sums of X
+  vector<Type> sy(ngroups);    // per-group sums of Y
+  vector<Type> ng(ngroups);    // group sizes
+  XtX.setZero();
+  XtY.setZero();
+  sx.setZero();
+  sy.setZero();
+  ng.setZero();
+  for(int i = 0; i < nobs; i++){
+    k = X3(i) - 1;
+    for(int a = 0; a < p; a++){
+      for(int b = 0; b <= a; b++){
+        XtX(a, b) += X(i, a) * X(i, b);
+      }
+      XtY(a) += X(i, a) * Y(i);
+      sx(k, a) += X(i, a);
+    }
+    YtY += Y(i) * Y(i);
+    sy(k) += Y(i);
+    ng(k) += Type(1);
+  }
+  for(int a = 0; a < p; a++){
+    for(int b = a + 1; b < p; b++){
+      XtX(a, b) = XtX(b, a);
+    }
+  }
+
+  Type s0sq = exp(Type(2) * logsig0);
+  Type s1sq = exp(Type(2) * logsig1);
+  vector<Type> gamma = s1sq / (s0sq + ng * s1sq);
+
+  // log|V| summed over groups
+  Type logdetV = Type(nobs) * log(s0sq) + log(Type(1) + ng * s1sq / s0sq).sum();
+
+  // s0^2 X'V^-1 X, s0^2 X'V^-1 Y and s0^2 Y'V^-1 Y
+  matrix<Type> A = XtX;
+  vector<Type> c = XtY;
+  Type d = YtY;
+  for(int g = 0; g < ngroups; g++){
+    for(int a = 0; a < p; a++){
+      for(int b = 0; b < p; b++){
+        A(a, b) -= gamma(g) * sx(g, a) * sx(g, b);
+      }
+      c(a) -= gamma(g) * sx(g, a) * sy(g);
+    }
+    d -= gamma(g) * sy(g) * sy(g);
+  }
+
+  // A = L L', needed for the GLS estimate and the REML correction
+  matrix<Type> L;
+  if(profile || reml){
+    L = chol_lower(A);
+  }
+
+  vector<Type> beta_hat(p);
+  if(profile){
+    // beta_hat = A^-1 c: forward then back substitution
+    vector<Type> w(p);
+    for(int r = 0; r < p; r++){
+      Type s = c(r);
+      for(int l = 0; l < r; l++){
+        s -= L(r, l) * w(l);
+      }
+      w(r) = s / L(r, r);
+    }
+    for(int r = p - 1; r >= 0; r--){
+      Type s = w(r);
+      for(int l = r + 1; l < p; l++){
+        s -= L(l, r) * beta_hat(l);
+      }
+      beta_hat(r) = s / L(r, r);
+    }
+  } else {
+    beta_hat = Beta;
+  }
+
+  // r'V^-1 r = (d - 2 beta'c + beta'A beta)/s0^2
+  vector<Type> Abeta = A * beta_hat;
+  Type quad = (d - Type(2) * (beta_hat * c).sum() + (beta_hat * Abeta).sum()) / s0sq;
+
+  Type nll = Type(0.5) * (Type(nobs) * log(Type(2 * M_PI)) + logdetV + quad);
+  if(reml){
+    // + log|X'V^-1 X|/2, without the p log(2 pi)/2 of the integrated Beta
+    Type logdetA = Type(0.0);
+    for(int a = 0; a < p; a++){
+      logdetA += log(L(a, a));
+    }
+    nll += logdetA - Type(0.5) * Type(p) * log(s0sq) - Type(0.5) * Type(p) * log(Type(2 * M_PI));
+  }
+
+  // BLUPs of the random intercepts, u_g = gamma_g sum(r_g)
+  vector<Type> u(ngroups);
+  for(int g = 0; g < ngroups; g++){
+    Type sr = sy(g);
+    for(int a = 0; a < p; a++){
+      sr -= sx(g, a) * beta_hat(a);
+    }
+    u(g) = gamma(g) * sr;
+  }
+
+  Type sig1 = exp(logsig1);
+  Type sig0 = exp(logsig0);
+  REPORT(beta_hat);
+  REPORT(u);
+  ADREPORT(beta_hat);
+  ADREPORT(sig1);
+  ADREPORT(sig0);
+
+  return nll;
+}
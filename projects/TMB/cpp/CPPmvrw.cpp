@@ -8,6 +8,7 @@ template<class Type>
 Type objective_function<Type>::operator() ()
 {
   DATA_ARRAY(obs); /* timeSteps x stateDim */
+  DATA_INTEGER(chunk_size); /* time steps per parallel region (>= 1) */
   PARAMETER(transf_rho);
   PARAMETER_VECTOR(logsds);
   PARAMETER_VECTOR(logsdObs);
@@ -22,21 +23,27 @@ Type objective_function<Type>::operator() ()
   vector<Type> sdObs=exp(logsdObs);
   
   // Setup object for evaluating multivariate normal likelihood
-  matrix<Type> cov(stateDim,stateDim);
-  for(int i=0;i<stateDim;i++)
-    for(int j=0;j<stateDim;j++)
-      cov(i,j)=pow(rho,Type(abs(i-j)))*sds[i]*sds[j];
-  
+  // The increments have covariance cov(i,j)=rho^|i-j|*sds[i]*sds[j], a unit
+  // AR(1) scaled by sds: its precision is tridiagonal, so the log
+  // determinant and quadratic form are O(stateDim) without forming cov.
   using namespace density;
-  MVNORM_t<Type> neg_log_density(cov);
+  VECSCALE_t<AR1_t<N01<Type> > > neg_log_density=VECSCALE(AR1(rho),sds);
   
   /* Define likelihood */
+  /* One PARALLEL_REGION per chunk of time steps [i0,i1), joined to the
+     previous chunk through the state u.col(i0-1) only */
   Type ans=0;
-  for(int i=1;i<timeSteps;i++)    
-    ans += neg_log_density(u.col(i)-u.col(i-1)); // Process likelihood
-  
-  for(int i=0; i<timeSteps; i++)
-    ans -= dnorm(obs.col(i).vec(), u.col(i).vec(), sdObs, true).sum(); // Data likelihood
+  if(chunk_size<1) error("chunk_size must be >= 1");
+  for(int i0=0;i0<timeSteps;i0+=chunk_size){
+    PARALLEL_REGION {
+      int i1=std::min(i0+chunk_size,timeSteps);
+      for(int i=std::max(i0,1);i<i1;i++)
+        ans += neg_log_density(u.col(i)-u.col(i-1)); // Process likelihood
+      
+      for(int i=i0; i<i1; i++)
+        ans -= dnorm(obs.col(i).vec(), u.col(i).vec(), sdObs, true).sum(); // Data likelihood
+    }
+  }
   
   return ans;
 }
\ No newline at end of file
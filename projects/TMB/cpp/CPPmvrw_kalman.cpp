@@ -0,0 +1,97 @@
+// Multivariate random walk, Kalman filter
+// Same model as CPPmvrw.cpp, with the states integrated out exactly by a
+// forward pass over time instead of declaring u random: per time step one
+// stateDim x stateDim positive definite inverse (atomic::matinvpd, which
+// also returns the log determinant). The smoothed states and their
+// variances are reported as u_smooth and u_var (stateDim x timeSteps).
+#include <TMB.hpp>
+
+/* Parameter transform */
+template <class Type>
+Type f(Type x){return Type(2)/(Type(1) + exp(-Type(2) * x)) - Type(1);}
+
+template<class Type>
+Type objective_function<Type>::operator() ()
+{
+  DATA_ARRAY(obs); /* stateDim x timeSteps */
+  PARAMETER(transf_rho);
+  PARAMETER_VECTOR(logsds);
+  PARAMETER_VECTOR(logsdObs);
+
+  int timeSteps=obs.dim[1];
+  int stateDim=obs.dim[0];
+  
+  Type rho=f(transf_rho);
+  
+  vector<Type> sds=exp(logsds);
+  vector<Type> sdObs=exp(logsdObs);
+  
+  // Process and observation covariances
+  matrix<Type> cov(stateDim,stateDim);
+  for(int i=0;i<stateDim;i++)
+    for(int j=0;j<stateDim;j++)
+      cov(i,j)=pow(rho,Type(abs(i-j)))*sds[i]*sds[j];
+  matrix<Type> covObs(stateDim,stateDim);
+  covObs.setZero();
+  for(int i=0;i<stateDim;i++)
+    covObs(i,i)=sdObs[i]*sdObs[i];
+  
+  // u.col(0) has a flat prior: given obs.col(0) it is N(obs.col(0), covObs)
+  // and obs.col(0) contributes no term
+  vector<Type> m=obs.col(0);
+  matrix<Type> P=covObs;
+  
+  // filtered moments kept for the smoother (double evaluations only)
+  int nstore=isDouble<Type>::value ? timeSteps : 0;
+  vector<vector<Type> > m_filt(nstore);
+  vector<matrix<Type> > P_filt(nstore), P_pred(nstore);
+  if(nstore>0){
+    m_filt(0)=m;
+    P_filt(0)=P;
+    P_pred(0)=P;
+  }
+  
+  /* Define likelihood */
+  Type ans=0;
+  for(int i=1;i<timeSteps;i++){
+    // random walk: the predicted mean is the filtered one
+    matrix<Type> Ppred=P+cov;
+    matrix<Type> F=Ppred+covObs;
+    vector<Type> v=obs.col(i).vec()-m;
+    Type logdetF;
+    matrix<Type> Finv=atomic::matinvpd(F,logdetF);
+    vector<Type> Finv_v=Finv*v;
+    ans += Type(0.5)*(Type(stateDim)*log(Type(2*M_PI)) + logdetF + (v*Finv_v).sum()); // Data likelihood given the past
+    matrix<Type> K=Ppred*Finv; // Kalman gain
+    m=m+K*v;
+    P=Ppred-K*Ppred;
+    if(nstore>0){
+      m_filt(i)=m;
+      P_filt(i)=P;
+      P_pred(i)=Ppred;
+    }
+  }
+  
+  // backward pass, for reporting only
+  if(nstore>0){
+    matrix<Type> u_smooth(stateDim,timeSteps), u_var(stateDim,timeSteps);
+    vector<Type> ms=m_filt(timeSteps-1);
+    matrix<Type> Ps=P_filt(timeSteps-1);
+    u_smooth.col(timeSteps-1)=ms.matrix();
+    u_var.col(timeSteps-1)=Ps.diagonal();
+    for(int i=timeSteps-2;i>=0;i--){
+      Type logdet;
+      matrix<Type> J=P_filt(i)*atomic::matinvpd(P_pred(i+1),logdet);
+      vector<Type> d=ms-m_filt(i);
+      ms=m_filt(i)+J*d;
+      matrix<Type> JT=J.transpose();
+      Ps=P_filt(i)+J*(Ps-P_pred(i+1))*JT;
+      u_smooth.col(i)=ms.matrix();
+      u_var.col(i)=Ps.diagonal();
+    }
+    REPORT(u_smooth);
+    REPORT(u_var);
+  }
+  
+  return ans;
+}
@@ -0,0 +1,355 @@
+// Shared pieces of the Poisson GLLVM templates (CPPGLLVM_poisson*.cpp)
+//
+// Loadings are kept in the packed form used by the templates: the diagonal
+// of the num_lv x p upper triangle is exp(loglam), and the entries above it
+// are stored row by row in lambda. The kernels below work on one tile of
+// species at a time, which is also the PARALLEL_REGION unit of the
+// templates, and are templated on the number of latent variables NLV
+// (Eigen::Dynamic for the general case).
+
+const int tile_p = 8;  // species per tile, also the parallel unit
+
+// Start of row k of the packed upper triangle of lambda, so that
+// lambda(lambda_row(k, p) + j) is the loading of species j > k on LV k
+inline int lambda_row(int k, int p){
+  return k*p - (k + 1)*k/2 - 1 - k;
+}
+
+// Dense num_lv x p loading matrix (upper triangular), for reporting and for
+// per-site work that needs every species
+template<class Type>
+matrix<Type> gllvm_newlam(const vector<Type> &lambda, const vector<Type> &lam_diag,
+                          int nlv, int p)
+{
+  matrix<Type> newlam(nlv, p);
+  newlam.setZero();
+  for (int j = 0; j < p; j++){
+    for (int k = 0; k < nlv && k <= j; k++){
+      newlam(k, j) = (k == j) ? lam_diag(j) : lambda(lambda_row(k, p) + j);
+    }
+  }
+  return newlam;
+}
+
+// Loadings of species j0..j1-1 as an nlv x tile_p block, read straight from
+// the packed storage; entries below the diagonal are zero
+template<class Type, int NLV>
+Eigen::Matrix<Type, NLV, tile_p> gllvm_loading_tile(const vector<Type> &lambda,
+                                                    const vector<Type> &lam_diag,
+                                                    int nlv, int p, int j0, int j1)
+{
+  Eigen::Matrix<Type, NLV, tile_p> lam_tile;
+  lam_tile.resize(nlv, tile_p);
+  lam_tile.setZero();
+  for (int j = j0; j < j1; j++){
+    for (int k = 0; k < nlv && k <= j; k++){
+      lam_tile(k, j - j0) = (k == j) ? lam_diag(j) : lambda(lambda_row(k, p) + j);
+    }
+  }
+  return lam_tile;
+}
+
+// Poisson log-likelihood of species j0..j1-1 over all sites. Each cell's
+// eta = b0 + x*b + u*lambda and its term y*eta - exp(eta) - lgamma(y + 1)
+// are formed in one pass, so no n x p eta (or x*b, u*lambda) is ever built.
+// The site loop is innermost: each species' column of y, and the columns of
+// x and u, are read in their column-major order.
+template<class Type, int NLV>
+Type gllvm_tile_nll(const matrix<Type> &y, const matrix<Type> &x,
+                    const vector<Type> &b0, const matrix<Type> &b,
+                    const vector<Type> &lambda, const vector<Type> &lam_diag,
+                    const matrix<Type> &u, int j0, int j1)
+{
+  int n = y.rows();
+  int p = y.cols();
+  int nx = x.cols();
+  int nlv = u.cols();
+
+  Eigen::Matrix<Type, NLV, tile_p> lam_tile =
+    gllvm_loading_tile<Type, NLV>(lambda, lam_diag, nlv, p, j0, j1);
+
+  Type ans = 0.0;
+  for (int j = j0; j < j1; j++){
+    int nk = std::min(j + 1, nlv);
+    for (int i = 0; i < n; i++){
+      Type eta = b0(j);
+      for (int k = 0; k < nx; k++)
+        eta += x(i, k)*b(k, j);
+      for (int k = 0; k < nk; k++)
+        eta += u(i, k)*lam_tile(k, j - j0);
+      ans += y(i, j)*eta - exp(eta) - lgamma(y(i, j) + Type(1));
+    }
+  }
+  return ans;
+}
+
+// Variational version of gllvm_tile_nll: with u_i ~ N(u_mean_i, A_i) and
+// A_i = L_i L_i', the expected Poisson log-likelihood of a cell is
+// y*eta - exp(eta + lambda_j' A_i lambda_j / 2) - lgamma(y + 1), with eta at
+// the variational mean. L_i is lower triangular with diagonal exp(A_logdiag)
+// and strictly lower entries A_lower (row i, column-major order of the
+// triangle).
+template<class Type, int NLV>
+Type gllvm_va_tile_nll(const matrix<Type> &y, const matrix<Type> &x,
+                       const vector<Type> &b0, const matrix<Type> &b,
+                       const vector<Type> &lambda, const vector<Type> &lam_diag,
+                       const matrix<Type> &u, const matrix<Type> &A_logdiag,
+                       const matrix<Type> &A_lower, int j0, int j1)
+{
+  int n = y.rows();
+  int p = y.cols();
+  int nx = x.cols();
+  int nlv = u.cols();
+
+  Eigen::Matrix<Type, NLV, tile_p> lam_tile =
+    gllvm_loading_tile<Type, NLV>(lambda, lam_diag, nlv, p, j0, j1);
+
+  Eigen::Matrix<Type, NLV, 1> u_i, v;
+  Eigen::Matrix<Type, NLV, NLV> L_i;
+  u_i.resize(nlv);
+  v.resize(nlv);
+  L_i.resize(nlv, nlv);
+  Type ans = 0.0;
+  for (int i = 0; i < n; i++){
+    L_i.setZero();
+    int l = 0;
+    for (int k = 0; k < nlv; k++){
+      u_i(k) = u(i, k);
+      L_i(k, k) = exp(A_logdiag(i, k));
+      for (int r = k + 1; r < nlv; r++)
+        L_i(r, k) = A_lower(i, l++);
+    }
+    for (int j = j0; j < j1; j++){
+      Type eta = b0(j);
+      for (int k = 0; k < nx; k++)
+        eta += x(i, k)*b(k, j);
+      int nk = std::min(j + 1, nlv);
+      for (int k = 0; k < nk; k++)
+        eta += u_i(k)*lam_tile(k, j - j0);
+      // v = L_i' lambda_j, so lambda_j' A_i lambda_j = v'v
+      v = L_i.transpose()*lam_tile.col(j - j0);
+      ans += y(i, j)*eta - exp(eta + Type(0.5)*v.squaredNorm()) - lgamma(y(i, j) + Type(1));
+    }
+  }
+  return ans;
+}
+
+// Poisson log-likelihood of species j0..j1-1 for a sparse count matrix y
+// (column-compressed, as DATA_SPARSE_MATRIX gives it). The log-density
+// y*eta - exp(eta) - lgamma(y + 1) is split into
+//   - sum of exp(eta) over every cell, the only dense pass;
+//   - sum of y*eta over the non-zeros, which per species is
+//     b0*sum(y) + (x'y)'b + (u'y)'lambda, so each non-zero costs num_lv
+//     products and x'y is data;
+//   - sum of lgamma(y + 1) over the non-zeros, which is data.
+// Zero cells therefore only pay for their linear predictor and one exp.
+template<class Type, int NLV>
+Type gllvm_sparse_tile_nll(const Eigen::SparseMatrix<Type> &y, const matrix<Type> &x,
+                           const vector<Type> &b0, const matrix<Type> &b,
+                           const vector<Type> &lambda, const vector<Type> &lam_diag,
+                           const matrix<Type> &u, int j0, int j1)
+{
+  typedef typename Eigen::SparseMatrix<Type>::InnerIterator nz_iterator;
+  int n = y.rows();
+  int p = y.cols();
+  int nx = x.cols();
+  int nlv = u.cols();
+
+  Eigen::Matrix<Type, NLV, tile_p> lam_tile =
+    gllvm_loading_tile<Type, NLV>(lambda, lam_diag, nlv, p, j0, j1);
+
+  Type ans = 0.0;
+  // non-zero cells: y*eta and lgamma(y + 1)
+  Eigen::Matrix<Type, NLV, 1> uty;
+  uty.resize(nlv);
+  vector<Type> xty(nx);
+  for (int j = j0; j < j1; j++){
+    Type ysum = 0.0;
+    uty.setZero();
+    xty.setZero();
+    for (nz_iterator it(y, j); it; ++it){
+      int i = it.row();
+      Type yij = it.value();
+      ysum += yij;
+      for (int k = 0; k < nx; k++)
+        xty(k) += yij*x(i, k);
+      for (int k = 0; k < nlv; k++)
+        uty(k) += yij*u(i, k);
+      ans -= lgamma(yij + Type(1));
+    }
+    ans += b0(j)*ysum;
+    for (int k = 0; k < nx; k++)
+      ans += xty(k)*b(k, j);
+    int nk = std::min(j + 1, nlv);
+    for (int k = 0; k < nk; k++)
+      ans += uty(k)*lam_tile(k, j - j0);
+  }
+
+  // every cell: exp(eta), sites innermost as in gllvm_tile_nll
+  for (int j = j0; j < j1; j++){
+    int nk = std::min(j + 1, nlv);
+    for (int i = 0; i < n; i++){
+      Type eta = b0(j);
+      for (int k = 0; k < nx; k++)
+        eta += x(i, k)*b(k, j);
+      for (int k = 0; k < nk; k++)
+        eta += u(i, k)*lam_tile(k, j - j0);
+      ans -= exp(eta);
+    }
+  }
+  return ans;
+}
+
+// -sum_j (y_j*eta_j - exp(eta_j)) + u'u/2 for one site, the objective
+// minimised by gllvm_score_site
+template<class Type, class U>
+Type gllvm_site_f(const vector<Type> &y_i, const vector<Type> &offset,
+                  const matrix<Type> &lam, const U &u)
+{
+  Type f = Type(0.5)*u.squaredNorm();
+  for (int j = 0; j < y_i.size(); j++){
+    Type eta = offset(j);
+    for (int k = 0; k < lam.rows(); k++)
+      eta += u(k)*lam(k, j);
+    f -= y_i(j)*eta - exp(eta);
+  }
+  return f;
+}
+
+// Posterior mode of one site's latent variables with b0, b and the loadings
+// held fixed, minimising from u = 0
+//   f(u) = -sum_j (y_j*eta_j - exp(eta_j)) + u'u/2,
+//   gradient = u - lambda (y - mu), Hessian H = lambda diag(mu) lambda' + I.
+// f is convex, but a full Newton step from far away can overshoot badly (a
+// site with large scores sees exp(eta) blow up), so each step is halved
+// until f decreases. Iterations stop once |gradient| < tol, when no
+// halved step decreases f, or after max_iter. offset holds b0 + x*b for the site and lam the dense
+// num_lv x p loadings. Returns the site's Laplace approximation of
+// -log p(y_i), fills u_hat, the approximate posterior standard errors
+// u_se = sqrt(diag(H^-1)) and grad_norm, the gradient norm at u_hat, so the
+// caller can flag sites that did not converge.
+// The iteration count and step sizes depend on the data (through asDouble),
+// so a taped objective is only valid at the values it was taped at: score
+// with type = "Fun".
+template<class Type, int NLV>
+Type gllvm_score_site(const vector<Type> &y_i, const vector<Type> &offset,
+                      const matrix<Type> &lam, int max_iter, double tol,
+                      vector<Type> &u_hat, vector<Type> &u_se, Type &grad_norm)
+{
+  int p = y_i.size();
+  int nlv = lam.rows();
+  Eigen::Matrix<Type, NLV, 1> u, g, step, u_new;
+  Eigen::Matrix<Type, NLV, NLV> H;
+  u.resize(nlv);
+  g.resize(nlv);
+  H.resize(nlv, nlv);
+  u.setZero();
+  Type f = gllvm_site_f(y_i, offset, lam, u);
+  for (int it = 0; it < max_iter; it++){
+    g = u;
+    H.setIdentity();
+    for (int j = 0; j < p; j++){
+      Type eta = offset(j);
+      for (int k = 0; k < nlv; k++)
+        eta += u(k)*lam(k, j);
+      Type mu = exp(eta);
+      for (int k = 0; k < nlv; k++){
+        g(k) -= (y_i(j) - mu)*lam(k, j);
+        for (int l = 0; l <= k; l++)
+          H(k, l) += mu*lam(k, j)*lam(l, j);
+      }
+    }
+    if (asDouble(sqrt(g.squaredNorm())) < tol)
+      break;
+    H.template triangularView<Eigen::StrictlyUpper>() = H.transpose();
+    step = H.llt().solve(g);
+    // step halving on f; if no halving decreases f, keep u and stop, and
+    // grad_norm reports the site as not converged
+    Type t = 1.0;
+    bool decreased = false;
+    for (int h = 0; h < 30; h++){
+      u_new = u - t*step;
+      Type f_new = gllvm_site_f(y_i, offset, lam, u_new);
+      if (asDouble(f_new) <= asDouble(f)){
+        u = u_new;
+        f = f_new;
+        decreased = true;
+        break;
+      }
+      t *= Type(0.5);
+    }
+    if (!decreased)
+      break;
+  }
+
+  // objective, gradient, Hessian and standard errors at the mode
+  Type ans = Type(0.5)*u.squaredNorm();
+  g = u;
+  H.setIdentity();
+  for (int j = 0; j < p; j++){
+    Type eta = offset(j);
+    for (int k = 0; k < nlv; k++)
+      eta += u(k)*lam(k, j);
+    Type mu = exp(eta);
+    ans -= y_i(j)*eta - mu - lgamma(y_i(j) + Type(1));
+    for (int k = 0; k < nlv; k++){
+      g(k) -= (y_i(j) - mu)*lam(k, j);
+      for (int l = 0; l <= k; l++)
+        H(k, l) += mu*lam(k, j)*lam(l, j);
+    }
+  }
+  grad_norm = sqrt(g.squaredNorm());
+  H.template triangularView<Eigen::StrictlyUpper>() = H.transpose();
+  Eigen::LLT< Eigen::Matrix<Type, NLV, NLV> > llt(H);
+  Eigen::Matrix<Type, NLV, NLV> Hinv = llt.solve(Eigen::Matrix<Type, NLV, NLV>::Identity(nlv, nlv));
+  for (int k = 0; k < nlv; k++){
+    u_hat(k) = u(k);
+    u_se(k) = sqrt(Hinv(k, k));
+    // log|H|/2 completes the Laplace approximation
+    ans += log(llt.matrixL()(k, k));
+  }
+  return ans;
+}
+
+// Kernels as class templates, so that gllvm_dispatch can pick NLV for them
+template<class Type, int NLV>
+struct gllvm_tile_kernel {
+  template<class... Args>
+  static Type eval(Args&&... args){ return gllvm_tile_nll<Type, NLV>(std::forward<Args>(args)...); }
+};
+
+template<class Type, int NLV>
+struct gllvm_va_tile_kernel {
+  template<class... Args>
+  static Type eval(Args&&... args){ return gllvm_va_tile_nll<Type, NLV>(std::forward<Args>(args)...); }
+};
+
+template<class Type, int NLV>
+struct gllvm_sparse_tile_kernel {
+  template<class... Args>
+  static Type eval(Args&&... args){ return gllvm_sparse_tile_nll<Type, NLV>(std::forward<Args>(args)...); }
+};
+
+template<class Type, int NLV>
+struct gllvm_score_site_kernel {
+  template<class... Args>
+  static Type eval(Args&&... args){ return gllvm_score_site<Type, NLV>(std::forward<Args>(args)...); }
+};
+
+// Calls Kernel<Type, NLV>::eval(args...) with NLV fixed at compile time for
+// the numbers of latent variables that have a specialised version, and
+// Eigen::Dynamic otherwise. This is the one place to add a rank.
+template<template<class, int> class Kernel, class Type, class... Args>
+Type gllvm_dispatch(int num_lv, Args&&... args)
+{
+  switch (num_lv){
+  case 1:
+    return Kernel<Type, 1>::eval(std::forward<Args>(args)...);
+  case 2:
+    return Kernel<Type, 2>::eval(std::forward<Args>(args)...);
+  case 3:
+    return Kernel<Type, 3>::eval(std::forward<Args>(args)...);
+  default:
+    return Kernel<Type, Eigen::Dynamic>::eval(std::forward<Args>(args)...);
+  }
+}
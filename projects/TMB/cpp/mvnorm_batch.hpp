@@ -0,0 +1,149 @@
+// Batched multivariate normal density for random effects
+//
+// Every grouped model has one k_size-vector of coefficients per level, all
+// N(0, Sigma). Instead of one MVNORM_t call per (copied) column, the
+// function below factorises Sigma = L L' once per evaluation and handles all
+// levels with a single forward-substitution pass over the k_size x nlevels
+// coefficient matrix:
+//   -log density = nlevels*(k_size*log(2*pi)/2 + sum(log(diag(L))))
+//                  + ||L^-1 u||^2/2
+// The factorisation depends on the covariance parameters only, so its cost
+// is independent of the number of levels; per level only the O(k_size^2/2)
+// triangular solve remains, with no inverse built and no columns copied.
+// k_size = 1 (random intercept) and 2 (intercept and slope) are dispatched
+// at run time to fixed-size versions of the same kernel.
+
+// Lower Cholesky factor of a positive definite matrix; Mat may be a
+// fixed-size Eigen matrix, in which case the loops unroll
+template<class Mat>
+Mat chol_lower(const Mat &Sigma)
+{
+  int k = Sigma.rows();
+  Mat L = Mat::Zero(k, k);
+  for(int c = 0; c < k; c++){
+    typename Mat::Scalar s = Sigma(c, c);
+    for(int l = 0; l < c; l++){
+      s -= L(c, l) * L(c, l);
+    }
+    L(c, c) = sqrt(s);
+    for(int r = c + 1; r < k; r++){
+      typename Mat::Scalar t = Sigma(r, c);
+      for(int l = 0; l < c; l++){
+        t -= L(r, l) * L(c, l);
+      }
+      L(r, c) = t / L(c, c);
+    }
+  }
+  return L;
+}
+
+// Negative log density of the columns of u, given the lower Cholesky
+// factor L of their covariance. K is k_size when known at compile time
+// (Eigen::Dynamic otherwise): for fixed K the factor and the per-level
+// solution live in stack-allocated fixed-size objects and the substitution
+// loops unroll, so for K = 1, 2 this is the closed form
+// w0 = u0/L00, w1 = (u1 - L10 w0)/L11.
+template<class Type, int K>
+Type mvnorm_chol_batch_nll_k(const Eigen::Matrix<Type, K, K> &L, const matrix<Type> &u)
+{
+  const int k = L.rows();
+  int nlev = u.cols();
+  Type logdet_half = 0.0;
+  for(int r = 0; r < k; r++){
+    logdet_half += log(L(r, r));
+  }
+  Type quad = 0.0;
+  Eigen::Matrix<Type, K, 1> w;
+  w.resize(k);
+  for(int j = 0; j < nlev; j++){
+    // w = L^-1 u(, j), forward substitution reading u in place
+    for(int r = 0; r < k; r++){
+      Type s = u(r, j);
+      for(int l = 0; l < r; l++){
+        s -= L(r, l) * w(l);
+      }
+      w(r) = s / L(r, r);
+      quad += w(r) * w(r);
+    }
+  }
+  return Type(nlev) * (Type(0.5 * k * log(2.0 * M_PI)) + logdet_half) + Type(0.5) * quad;
+}
+
+// Density given the Cholesky factor as a (dynamic) matrix
+template<class Type, int K>
+struct mvnorm_chol_kernel {
+  static Type eval(const matrix<Type> &L, const matrix<Type> &u){
+    Eigen::Matrix<Type, K, K> Lk = L;
+    return mvnorm_chol_batch_nll_k<Type, K>(Lk, u);
+  }
+};
+
+// Density given sds and one common correlation rho,
+// Sigma(i, j) = rho^(i != j) sd(i) sd(j): Sigma and its factor are built
+// at size K as well, so for k_size = 1, 2 nothing is heap-allocated
+template<class Type, int K>
+struct mvnorm_sdcor_kernel {
+  static Type eval(const vector<Type> &sd, const Type &rho, const matrix<Type> &u){
+    int k = sd.size();
+    Eigen::Matrix<Type, K, K> Sigma;
+    Sigma.resize(k, k);
+    for(int i = 0; i < k; i++){
+      for(int j = 0; j < k; j++){
+        Sigma(i, j) = (i == j) ? sd(i) * sd(i) : rho * sd(i) * sd(j);
+      }
+    }
+    return mvnorm_chol_batch_nll_k<Type, K>(chol_lower(Sigma), u);
+  }
+};
+
+// Calls Kernel<Type, K>::eval(args...) with K = k_size fixed at compile
+// time for k_size = 1, 2 and Eigen::Dynamic otherwise
+template<template<class, int> class Kernel, class Type, class... Args>
+Type mvnorm_batch_dispatch(int k_size, Args&&... args)
+{
+  switch(k_size){
+  case 1:
+    return Kernel<Type, 1>::eval(std::forward<Args>(args)...);
+  case 2:
+    return Kernel<Type, 2>::eval(std::forward<Args>(args)...);
+  default:
+    return Kernel<Type, Eigen::Dynamic>::eval(std::forward<Args>(args)...);
+  }
+}
+
+// Negative log density of the columns of u, given the lower Cholesky
+// factor L of their covariance
+template<class Type>
+Type mvnorm_chol_batch_nll(const matrix<Type> &L, const matrix<Type> &u)
+{
+  return mvnorm_batch_dispatch<mvnorm_chol_kernel, Type>(L.rows(), L, u);
+}
+
+// Negative log density of the columns of u, each N(0, Sigma) with
+// Sigma built from sd and rho as in mvnorm_sdcor_kernel
+template<class Type>
+Type mvnorm_sdcor_batch_nll(const vector<Type> &sd, const Type &rho, const matrix<Type> &u)
+{
+  return mvnorm_batch_dispatch<mvnorm_sdcor_kernel, Type>(sd.size(), sd, rho, u);
+}
+
+// Lower Cholesky factor from unconstrained parameters: diagonal
+// exp(log_diag), strictly lower entries `lower` in column-major order
+// (k*(k - 1)/2 of them). Any parameter values give a valid factor, so the
+// covariance L L' is positive definite by construction and can go straight
+// to mvnorm_chol_batch_nll with no further factorisation.
+template<class Type>
+matrix<Type> chol_from_par(const vector<Type> &log_diag, const vector<Type> &lower)
+{
+  int k = log_diag.size();
+  matrix<Type> L(k, k);
+  L.setZero();
+  int l = 0;
+  for(int c = 0; c < k; c++){
+    L(c, c) = exp(log_diag(c));
+    for(int r = c + 1; r < k; r++){
+      L(r, c) = lower(l++);
+    }
+  }
+  return L;
+}